@@ -0,0 +1,90 @@
+// Benchmark for the fog of war visibility (make bench)
+// Moves Player A over every free cell of the largest possible map and
+// times each visibility recompute. Each cell keeps its fastest time over
+// all rounds (so a context switch does not count as a slow move), the
+// benchmark fails if the slowest cell takes 1 ms or more.
+
+#define main game_main   // Reuse the game code without its main()
+#include "game.c"
+#undef main
+
+#define BENCH_ROUNDS 200          // Passes over all free cells
+#define MAX_MOVE_NS 1000000L      // Limit per move: 1 ms
+
+// Build a MAX_HEIGHT x MAX_WIDTH map with a border
+// pillars = 1 adds walls on every third cell to create many shadows
+void build_map(GameState *gs, int pillars) {
+    gs->height = MAX_HEIGHT;
+    gs->width = MAX_WIDTH;
+
+    for (int i = 0; i < MAX_HEIGHT; i++) {
+        for (int j = 0; j < MAX_WIDTH; j++) {
+            int border = (i == 0 || j == 0 || i == MAX_HEIGHT - 1 || j == MAX_WIDTH - 1);
+            int pillar = pillars && i % 3 == 0 && j % 3 == 0;
+            gs->map[i][j] = (border || pillar) ? '#' : ' ';
+        }
+    }
+}
+
+// Time update_visibility() on every free cell, returns 1 if within the limit
+int run_bench(const char *name, int pillars) {
+    GameState gs;
+    memset(&gs, 0, sizeof(gs));
+    build_map(&gs, pillars);
+
+    long best_ns[MAX_HEIGHT][MAX_WIDTH];
+    long total_ns = 0;
+    int moves = 0;
+
+    for (int i = 0; i < MAX_HEIGHT; i++)
+        for (int j = 0; j < MAX_WIDTH; j++)
+            best_ns[i][j] = -1;
+
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < gs.height; i++) {
+            for (int j = 0; j < gs.width; j++) {
+                if (gs.map[i][j] != ' ')
+                    continue;
+
+                // Each move lands on a new cell, so the bitset is recomputed
+                gs.player1_x = j;
+                gs.player1_y = i;
+
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                update_visibility(&gs, 'A');
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                long ns = elapsed_ns(&start, &end);
+                total_ns += ns;
+                if (best_ns[i][j] < 0 || ns < best_ns[i][j])
+                    best_ns[i][j] = ns;
+                moves++;
+            }
+        }
+    }
+
+    // Slowest cell
+    long max_ns = 0;
+    for (int i = 0; i < MAX_HEIGHT; i++)
+        for (int j = 0; j < MAX_WIDTH; j++)
+            if (best_ns[i][j] > max_ns)
+                max_ns = best_ns[i][j];
+
+    printf("%-8s %d moves, avg %.2f us, slowest cell %.2f us per move\n",
+           name, moves, total_ns / 1000.0 / moves, max_ns / 1000.0);
+
+    return max_ns < MAX_MOVE_NS;
+}
+
+int main() {
+    int ok = 1;
+    ok &= run_bench("open", 0);
+    ok &= run_bench("pillars", 1);
+
+    if (!ok) {
+        fprintf(stderr, "Visibility took 1 ms or more for a single move\n");
+        return 1;
+    }
+    return 0;
+}
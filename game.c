@@ -7,6 +7,7 @@
 #include <sys/shm.h>    // For shmget, shmat, shmdt (shared memory)
 #include <sys/sem.h>    // For semget, semop, semctl (semaphores)
 #include <signal.h>     // For signal handling (SIGINT, SIGTERM)
+#include <time.h>       // For clock_gettime
 
 #include <ncurses.h>    // For ncurses library
 
@@ -17,14 +18,23 @@
 #define MAX_WIDTH 20             // Maximum width of the game map
 
 #define INITIAL_HP 5             // Initial health points for each player
-#define SEM_PROJECTILE_UPDATE 400 // Special semaphore index for projectile updates
+#define SEM_PROJECTILE_UPDATE 400 // Special semaphore index for simulation ticks and input queues
+#define MAX_PENDING_INPUTS 32    // Inputs of a player waiting for the next tick
 
 typedef struct {
     int x, y;                    // Projectile position
     int dir_x, dir_y;            // Projectile direction
     int active;                  // 1 if projectile is active, 0 otherwise
+    char owner;                  // 'A' or 'B' (player who fired it)
 } Projectile;
 
+typedef struct {
+    int seq;                     // Input sequence number (per player, 0 = not predicted)
+    int tick;                    // Predicted tick the input was issued in
+    int dx, dy;                  // Movement direction
+    int fire;                    // 1 = fire instead of moving
+} InputCmd;
+
 typedef struct {
     char map[MAX_HEIGHT][MAX_WIDTH]; // Game map
     int height, width;               // Map dimensions
@@ -52,6 +62,19 @@ typedef struct {
 
     int player1_active;    // Active status for Player 1
     int player2_active;    // Active status for Player 2
+
+    int fog_of_war;        // 1 = players only see cells visible from their tank
+
+    int tick;                   // Simulation tick, advanced by simulate_tick()
+
+    // Inputs waiting for the next tick (protected by SEM_PROJECTILE_UPDATE)
+    InputCmd player1_queue[MAX_PENDING_INPUTS];
+    InputCmd player2_queue[MAX_PENDING_INPUTS];
+    int player1_queue_len;
+    int player2_queue_len;
+
+    int player1_input_seq;      // Last input of Player A applied to this state
+    int player2_input_seq;      // Last input of Player B applied to this state
 } GameState;
 
 // Global variables
@@ -61,6 +84,33 @@ int sem_id = -1;               // Semaphore array ID
 char player_id;                // 'A' or 'B' (ID of this process)
 char map_file[256];            // Path to the map file
 int should_cleanup = 0;        // 1 = this process should clean up IPC resources
+int fog_requested = 0;         // 1 = "fog" was given on the command line
+
+// Visibility bitsets (one bit per map cell), index 0 = Player A, 1 = Player B
+// Kept in process memory: each process only needs what its own player sees
+unsigned char visibility[2][(MAX_HEIGHT * MAX_WIDTH + 7) / 8];
+int visibility_x[2] = {-1, -1};  // Position the bitset was computed from
+int visibility_y[2] = {-1, -1};
+
+// Client-side prediction
+// Inputs only reach the shared state at the next simulation tick, so we
+// draw a private copy with our own inputs applied right away. Every frame
+// the copy is rolled back to the shared state and re-simulated up to our
+// local tick, with the inputs the shared state has not applied yet.
+GameState predicted_state;                   // Local predicted copy
+InputCmd pending_inputs[MAX_PENDING_INPUTS]; // Our inputs, oldest first
+int pending_count = 0;
+int next_input_seq = 0;
+int local_tick = 0;                          // Tick the predicted copy runs at
+
+// Rollback statistics, collected over one second
+struct timespec stats_start;
+int rollback_count = 0;         // Rollbacks (resyncs with something re-simulated) in the current second
+int rollback_depth_max = 0;     // Most ticks re-simulated by one rollback
+long resim_ns = 0;              // Time spent rolling back and re-simulating
+int shown_rollbacks = 0;        // Values of the last full second (displayed)
+int shown_depth_max = 0;
+long shown_resim_us = 0;
 
 // Calculate semaphore index for a position (y, x)
 // e.g., Position (5, 7) -> Semaphore 107 (5 * 20 + 7)
@@ -69,9 +119,10 @@ int get_sem_index(int y, int x) {
 }
 
 // Lock a position (y, x)
-void lock_position(int y, int x) {
+// Only the shared state is locked, local copies belong to this process
+void lock_position(GameState *gs, int y, int x) {
     // Check bounds
-    if (y < 0 || y >= MAX_HEIGHT || x < 0 || x >= MAX_WIDTH)
+    if (gs != game_state || y < 0 || y >= MAX_HEIGHT || x < 0 || x >= MAX_WIDTH)
         return;
 
     struct sembuf op;
@@ -82,8 +133,8 @@ void lock_position(int y, int x) {
 }
 
 // Unlock a position (y, x)
-void unlock_position(int y, int x) {
-    if (y < 0 || y >= MAX_HEIGHT || x < 0 || x >= MAX_WIDTH)
+void unlock_position(GameState *gs, int y, int x) {
+    if (gs != game_state || y < 0 || y >= MAX_HEIGHT || x < 0 || x >= MAX_WIDTH)
         return;
 
     struct sembuf op;
@@ -104,6 +155,15 @@ int try_lock_projectile_update() {
     return (semop(sem_id, &op, 1) == 0);
 }
 
+// Lock the projectile update semaphore (wait if the other process has it)
+void lock_projectile_update() {
+    struct sembuf op;
+    op.sem_num = SEM_PROJECTILE_UPDATE;
+    op.sem_op = -1;
+    op.sem_flg = 0;
+    semop(sem_id, &op, 1);
+}
+
 // Unlock the projectile update semaphore
 void unlock_projectile_update() {
     struct sembuf op;
@@ -232,71 +292,198 @@ void init_game() {
 
     game_state->player1_active = 0;
     game_state->player2_active = 0;
+
+    // The first process decides the fog mode for both players
+    game_state->fog_of_war = fog_requested;
+
+    game_state->tick = 0;
+    game_state->player1_queue_len = 0;
+    game_state->player2_queue_len = 0;
+    game_state->player1_input_seq = 0;
+    game_state->player2_input_seq = 0;
+}
+
+// Mark cell (y, x) as visible for player index idx
+void set_visible(int idx, int y, int x) {
+    int bit = get_sem_index(y, x);  // Same y * MAX_WIDTH + x layout
+    visibility[idx][bit / 8] |= 1 << (bit % 8);
+}
+
+// Returns 1 if cell (y, x) is visible for player index idx
+int is_visible(int idx, int y, int x) {
+    int bit = get_sem_index(y, x);
+    return (visibility[idx][bit / 8] >> (bit % 8)) & 1;
+}
+
+// Returns 1 if cell (y, x) blocks line of sight (walls and outside the map)
+int blocks_sight(GameState *gs, int y, int x) {
+    if (x < 0 || x >= gs->width || y < 0 || y >= gs->height)
+        return 1;
+    return gs->map[y][x] == '#';
 }
 
-// Draw the game state
-void draw_game() {
+// Recursive shadowcasting for one octant
+// Scans rows moving away from (cx, cy), the slopes start/end bound the
+// part of the row that is still lit. When a wall is found the lit part
+// to its left is scanned recursively and the scan continues to its right.
+// xx, xy, yx, yy transform octant coordinates into map coordinates.
+void cast_light(GameState *gs, int idx, int cx, int cy, int row, float start, float end,
+                int radius, int xx, int xy, int yx, int yy) {
+    if (start < end)
+        return;
+
+    float new_start = 0.0f;
+    for (int j = row; j <= radius; j++) {
+        int dy = -j;
+        int blocked = 0;
+
+        for (int dx = -j; dx <= 0; dx++) {
+            // Map coordinates of the cell
+            int x = cx + dx * xx + dy * xy;
+            int y = cy + dx * yx + dy * yy;
+
+            // Slopes of the cell's left and right edges
+            float l_slope = (dx - 0.5f) / (dy + 0.5f);
+            float r_slope = (dx + 0.5f) / (dy - 0.5f);
+
+            if (start < r_slope)
+                continue;     // Not yet in the lit part
+            else if (end > l_slope)
+                break;        // Past the lit part
+
+            // Walls are visible too, only what is behind them is hidden
+            if (x >= 0 && x < gs->width && y >= 0 && y < gs->height)
+                set_visible(idx, y, x);
+
+            if (blocked) {
+                if (blocks_sight(gs, y, x)) {
+                    new_start = r_slope;  // Still in shadow
+                    continue;
+                }
+                // Wall ended, continue scanning
+                blocked = 0;
+                start = new_start;
+            } else if (blocks_sight(gs, y, x) && j < radius) {
+                // Wall starts, scan the lit part on its left in the next row
+                blocked = 1;
+                cast_light(gs, idx, cx, cy, j + 1, start, l_slope, radius, xx, xy, yx, yy);
+                new_start = r_slope;
+            }
+        }
+
+        if (blocked)
+            break;  // The rest of the octant is behind a wall
+    }
+}
+
+// Recompute the visibility of a player, only if the player has moved
+void update_visibility(GameState *gs, char which_player) {
+    // Octant transforms: {xx, xy, yx, yy} for each of the 8 octants
+    static const int octants[8][4] = {
+        { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+        {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1}
+    };
+
+    int idx = (which_player == 'A') ? 0 : 1;
+    int px = (which_player == 'A') ? gs->player1_x : gs->player2_x;
+    int py = (which_player == 'A') ? gs->player1_y : gs->player2_y;
+
+    // The map never changes, so the result only depends on the position
+    if (px == visibility_x[idx] && py == visibility_y[idx])
+        return;
+
+    memset(visibility[idx], 0, sizeof(visibility[idx]));
+    set_visible(idx, py, px);  // Own cell is always visible
+
+    int radius = gs->width > gs->height ?
+                 gs->width : gs->height;
+    for (int o = 0; o < 8; o++) {
+        cast_light(gs, idx, px, py, 1, 1.0f, 0.0f, radius,
+                   octants[o][0], octants[o][1], octants[o][2], octants[o][3]);
+    }
+
+    visibility_x[idx] = px;
+    visibility_y[idx] = py;
+}
+
+// Draw a game state (shared or predicted)
+void draw_game(GameState *gs) {
     clear();  // Clear the screen
 
-    // Draw the map
-    for (int i = 0; i < game_state->height; i++) {
-        for (int j = 0; j < game_state->width; j++) {
-            char c = game_state->map[i][j];  // Map character
+    int me = (player_id == 'A') ? 0 : 1;
+    if (gs->fog_of_war)
+        update_visibility(gs, player_id);
 
-            // Override with players
-            if (i == game_state->player1_y && j == game_state->player1_x)
+    // Draw the map
+    for (int i = 0; i < gs->height; i++) {
+        for (int j = 0; j < gs->width; j++) {
+            // Cells not visible from our tank hide what is on them
+            int hidden = gs->fog_of_war && !is_visible(me, i, j);
+            char c = hidden ? ' ' : gs->map[i][j];  // Map character
+
+            // Override with players (own tank is never hidden)
+            if (!hidden && i == gs->player1_y && j == gs->player1_x)
                 c = 'A';
-            else if (i == game_state->player2_y && j == game_state->player2_x)
+            else if (!hidden && i == gs->player2_y && j == gs->player2_x)
                 c = 'B';
             else {
-                // Check for projectiles
+                // Check for projectiles (enemy ones only when visible)
                 for (int p = 0; p < 10; p++) {
-                    if (game_state->projectiles[p].active &&
-                        game_state->projectiles[p].y == i &&
-                        game_state->projectiles[p].x == j) {
+                    if (gs->projectiles[p].active &&
+                        (!hidden || gs->projectiles[p].owner == player_id) &&
+                        gs->projectiles[p].y == i &&
+                        gs->projectiles[p].x == j) {
                         c = '.';
                         break;
                     }
                 }
             }
             // Draw the character at position (i, j)
-            mvaddch(i, j, c);
+            // Fog is drawn as a dim checkerboard so it differs from open floor
+            if (hidden && c == ' ')
+                mvaddch(i, j, ACS_CKBOARD | A_DIM);
+            else
+                mvaddch(i, j, c);
         }
     }
 
     // Display stats on the right side of the map
-    mvprintw(0, game_state->width + 2, "Player A: %d HP", game_state->player1_hp);
-    mvprintw(1, game_state->width + 2, "Player B: %d HP", game_state->player2_hp);
-    mvprintw(3, game_state->width + 2, "You are: Player %c", player_id);
-    mvprintw(5, game_state->width + 2, "Controls:");
+    mvprintw(0, gs->width + 2, "Player A: %d HP", gs->player1_hp);
+    mvprintw(1, gs->width + 2, "Player B: %d HP", gs->player2_hp);
+    mvprintw(3, gs->width + 2, "You are: Player %c", player_id);
+    mvprintw(5, gs->width + 2, "Controls:");
 
     // Display key bindings from shared memory
-    if (game_state->player1_registered) {
-        mvprintw(6, game_state->width + 2, "A: %c/%c/%c/%c/%c",
-                 game_state->player1_keys[0],
-                 game_state->player1_keys[1],
-                 game_state->player1_keys[2],
-                 game_state->player1_keys[3],
-                 game_state->player1_keys[4] == ' ' ? 'S' : game_state->player1_keys[4]);
+    if (gs->player1_registered) {
+        mvprintw(6, gs->width + 2, "A: %c/%c/%c/%c/%c",
+                 gs->player1_keys[0],
+                 gs->player1_keys[1],
+                 gs->player1_keys[2],
+                 gs->player1_keys[3],
+                 gs->player1_keys[4] == ' ' ? 'S' : gs->player1_keys[4]);
     } else {
-        mvprintw(6, game_state->width + 2, "A: waiting...");
+        mvprintw(6, gs->width + 2, "A: waiting...");
     }
 
-    if (game_state->player2_registered) {
-        mvprintw(7, game_state->width + 2, "B: %c/%c/%c/%c/%c",
-                 game_state->player2_keys[0],  // up
-                 game_state->player2_keys[1],  // down
-                 game_state->player2_keys[2],  // left
-                 game_state->player2_keys[3],  // right
-                 game_state->player2_keys[4] == ' ' ? 'S' : game_state->player2_keys[4]);
+    if (gs->player2_registered) {
+        mvprintw(7, gs->width + 2, "B: %c/%c/%c/%c/%c",
+                 gs->player2_keys[0],  // up
+                 gs->player2_keys[1],  // down
+                 gs->player2_keys[2],  // left
+                 gs->player2_keys[3],  // right
+                 gs->player2_keys[4] == ' ' ? 'S' : gs->player2_keys[4]);
     } else {
-        mvprintw(7, game_state->width + 2, "B: waiting...");
+        mvprintw(7, gs->width + 2, "B: waiting...");
     }
 
+    // Prediction statistics of the last second
+    mvprintw(9, gs->width + 2, "Rollbacks: %d/s (depth %d)", shown_rollbacks, shown_depth_max);
+    mvprintw(10, gs->width + 2, "Resim: %ld us/s", shown_resim_us);
+
     // Display Game Over message
-    if (game_state->game_over) {
-        char winner = (game_state->player1_hp > 0) ? 'A' : 'B';
-        mvprintw(game_state->height / 2, game_state->width / 2 - 10,
+    if (gs->game_over) {
+        char winner = (gs->player1_hp > 0) ? 'A' : 'B';
+        mvprintw(gs->height / 2, gs->width / 2 - 10,
                  "GAME OVER! Player %c wins!", winner);
     }
 
@@ -305,20 +492,21 @@ void draw_game() {
 }
 
 // Move a player
-void move_player(char which_player, int dx, int dy) {
+// Works on any state, it only depends on the state and its arguments
+void move_player(GameState *gs, char which_player, int dx, int dy) {
     // Determine pointers to player data
     int *px, *py, *dir_x, *dir_y;
 
     if (which_player == 'A') {
-        px = &game_state->player1_x;
-        py = &game_state->player1_y;
-        dir_x = &game_state->player1_dir_x;
-        dir_y = &game_state->player1_dir_y;
+        px = &gs->player1_x;
+        py = &gs->player1_y;
+        dir_x = &gs->player1_dir_x;
+        dir_y = &gs->player1_dir_y;
     } else {
-        px = &game_state->player2_x;
-        py = &game_state->player2_y;
-        dir_x = &game_state->player2_dir_x;
-        dir_y = &game_state->player2_dir_y;
+        px = &gs->player2_x;
+        py = &gs->player2_y;
+        dir_x = &gs->player2_dir_x;
+        dir_y = &gs->player2_dir_y;
     }
 
     // Calculate new position
@@ -328,21 +516,21 @@ void move_player(char which_player, int dx, int dy) {
     int new_y = old_y + dy;
 
     // Check map bounds
-    if (new_x < 0 || new_x >= game_state->width ||
-        new_y < 0 || new_y >= game_state->height)
+    if (new_x < 0 || new_x >= gs->width ||
+        new_y < 0 || new_y >= gs->height)
         return;
 
     // Lock both positions
-    lock_position(old_y, old_x);
-    lock_position(new_y, new_x);
+    lock_position(gs, old_y, old_x);
+    lock_position(gs, new_y, new_x);
 
     // Check if the position is free
-    char cell = game_state->map[new_y][new_x];
+    char cell = gs->map[new_y][new_x];
 
     if (cell == ' ' && // Free space
         // Not occupied by the other player
-        !(new_y == game_state->player1_y && new_x == game_state->player1_x && which_player != 'A') &&
-        !(new_y == game_state->player2_y && new_x == game_state->player2_x && which_player != 'B')) {
+        !(new_y == gs->player1_y && new_x == gs->player1_x && which_player != 'A') &&
+        !(new_y == gs->player2_y && new_x == gs->player2_x && which_player != 'B')) {
         // Move player
         *px = new_x;
         *py = new_y;
@@ -351,25 +539,25 @@ void move_player(char which_player, int dx, int dy) {
     }
 
     // Unlock positions
-    unlock_position(new_y, new_x);
-    unlock_position(old_y, old_x);
+    unlock_position(gs, new_y, new_x);
+    unlock_position(gs, old_y, old_x);
 }
 
 // Fire a projectile
-void fire_projectile(char which_player) {
+void fire_projectile(GameState *gs, char which_player) {
     // Determine starting coordinates and direction of the projectile
     int start_x, start_y, proj_dir_x, proj_dir_y;
 
     if (which_player == 'A') {
-        start_x = game_state->player1_x;
-        start_y = game_state->player1_y;
-        proj_dir_x = game_state->player1_dir_x;
-        proj_dir_y = game_state->player1_dir_y;
+        start_x = gs->player1_x;
+        start_y = gs->player1_y;
+        proj_dir_x = gs->player1_dir_x;
+        proj_dir_y = gs->player1_dir_y;
     } else {
-        start_x = game_state->player2_x;
-        start_y = game_state->player2_y;
-        proj_dir_x = game_state->player2_dir_x;
-        proj_dir_y = game_state->player2_dir_y;
+        start_x = gs->player2_x;
+        start_y = gs->player2_y;
+        proj_dir_x = gs->player2_dir_x;
+        proj_dir_y = gs->player2_dir_y;
     }
 
     // Initial projectile position (in front of the player)
@@ -377,16 +565,16 @@ void fire_projectile(char which_player) {
     int proj_y = start_y + proj_dir_y;
 
     // Check map bounds
-    if (proj_x < 0 || proj_x >= game_state->width ||
-        proj_y < 0 || proj_y >= game_state->height)
+    if (proj_x < 0 || proj_x >= gs->width ||
+        proj_y < 0 || proj_y >= gs->height)
         return;
 
-    lock_position(proj_y, proj_x);
+    lock_position(gs, proj_y, proj_x);
 
     // Check for an available projectile slot
     int slot = -1;
     for (int i = 0; i < 10; i++) {
-        if (!game_state->projectiles[i].active) {
+        if (!gs->projectiles[i].active) {
             slot = i;
             break;
         }
@@ -394,33 +582,34 @@ void fire_projectile(char which_player) {
 
     // If a slot is available, initialize the projectile
     if (slot != -1) {
-        game_state->projectiles[slot].x = proj_x;
-        game_state->projectiles[slot].y = proj_y;
-        game_state->projectiles[slot].dir_x = proj_dir_x;
-        game_state->projectiles[slot].dir_y = proj_dir_y;
-        game_state->projectiles[slot].active = 1;
+        gs->projectiles[slot].x = proj_x;
+        gs->projectiles[slot].y = proj_y;
+        gs->projectiles[slot].dir_x = proj_dir_x;
+        gs->projectiles[slot].dir_y = proj_dir_y;
+        gs->projectiles[slot].active = 1;
+        gs->projectiles[slot].owner = which_player;
     }
 
-    unlock_position(proj_y, proj_x);
+    unlock_position(gs, proj_y, proj_x);
 }
 
 // Update projectile positions
-void update_projectiles() {
+void update_projectiles(GameState *gs) {
     int next_positions[10][2]; // next_positions[i] = {next_x, next_y}
     int to_deactivate[10] = {0}; // 1 if projectile i should be deactivated
 
     // Calculate next positions
     for (int i = 0; i < 10; i++) {
-        if (!game_state->projectiles[i].active) {
+        if (!gs->projectiles[i].active) {
             next_positions[i][0] = -1;
             next_positions[i][1] = -1;
             continue;
         }
 
-        int proj_x = game_state->projectiles[i].x;
-        int proj_y = game_state->projectiles[i].y;
-        int dir_x = game_state->projectiles[i].dir_x;
-        int dir_y = game_state->projectiles[i].dir_y;
+        int proj_x = gs->projectiles[i].x;
+        int proj_y = gs->projectiles[i].y;
+        int dir_x = gs->projectiles[i].dir_x;
+        int dir_y = gs->projectiles[i].dir_y;
 
         // Calculate new position
         next_positions[i][0] = proj_x + dir_x;
@@ -430,11 +619,11 @@ void update_projectiles() {
     // Check for projectile collisions
     // Check all pairs of projectiles
     for (int i = 0; i < 10; i++) {
-        if (!game_state->projectiles[i].active || to_deactivate[i])
+        if (!gs->projectiles[i].active || to_deactivate[i])
             continue;
 
         for (int j = i + 1; j < 10; j++) {
-            if (!game_state->projectiles[j].active || to_deactivate[j])
+            if (!gs->projectiles[j].active || to_deactivate[j])
                 continue;
 
             // Direct collision - Both projectiles reach the same position
@@ -446,10 +635,10 @@ void update_projectiles() {
             }
 
             // Indirect collision - Projectiles cross paths
-            if (next_positions[i][0] == game_state->projectiles[j].x &&
-                next_positions[i][1] == game_state->projectiles[j].y &&
-                next_positions[j][0] == game_state->projectiles[i].x &&
-                next_positions[j][1] == game_state->projectiles[i].y) {
+            if (next_positions[i][0] == gs->projectiles[j].x &&
+                next_positions[i][1] == gs->projectiles[j].y &&
+                next_positions[j][0] == gs->projectiles[i].x &&
+                next_positions[j][1] == gs->projectiles[i].y) {
                 to_deactivate[i] = 1;
                 to_deactivate[j] = 1;
             }
@@ -458,80 +647,254 @@ void update_projectiles() {
 
     // Update projectile positions
     for (int i = 0; i < 10; i++) {
-        if (!game_state->projectiles[i].active)
+        if (!gs->projectiles[i].active)
             continue;
 
         // Current and next positions
-        int proj_x = game_state->projectiles[i].x;
-        int proj_y = game_state->projectiles[i].y;
+        int proj_x = gs->projectiles[i].x;
+        int proj_y = gs->projectiles[i].y;
         int next_x = next_positions[i][0];
         int next_y = next_positions[i][1];
 
         // If projectile should be deactivated (collision)
         if (to_deactivate[i]) {
             // Deactivate the projectile
-            lock_position(proj_y, proj_x);
-            game_state->projectiles[i].active = 0;
-            unlock_position(proj_y, proj_x);
+            lock_position(gs, proj_y, proj_x);
+            gs->projectiles[i].active = 0;
+            unlock_position(gs, proj_y, proj_x);
             continue;
         }
 
         // Check map bounds
-        if (next_x < 0 || next_x >= game_state->width ||
-            next_y < 0 || next_y >= game_state->height) {
-            lock_position(proj_y, proj_x);
-            game_state->projectiles[i].active = 0;
-            unlock_position(proj_y, proj_x);
+        if (next_x < 0 || next_x >= gs->width ||
+            next_y < 0 || next_y >= gs->height) {
+            lock_position(gs, proj_y, proj_x);
+            gs->projectiles[i].active = 0;
+            unlock_position(gs, proj_y, proj_x);
             continue;
         }
 
-        lock_position(proj_y, proj_x);
-        lock_position(next_y, next_x);
+        lock_position(gs, proj_y, proj_x);
+        lock_position(gs, next_y, next_x);
 
         // Check collision with walls
-        if (game_state->map[next_y][next_x] == '#') {
-            game_state->projectiles[i].active = 0;
-            unlock_position(next_y, next_x);
-            unlock_position(proj_y, proj_x);
+        if (gs->map[next_y][next_x] == '#') {
+            gs->projectiles[i].active = 0;
+            unlock_position(gs, next_y, next_x);
+            unlock_position(gs, proj_y, proj_x);
             continue;
         }
 
         // Check collision with players
         // Collision with Player 1
-        if (next_y == game_state->player1_y && next_x == game_state->player1_x) {
-            game_state->player1_hp--;
-            if (game_state->player1_hp <= 0)
-                game_state->game_over = 1;
-            game_state->projectiles[i].active = 0;
-            unlock_position(next_y, next_x);
-            unlock_position(proj_y, proj_x);
+        if (next_y == gs->player1_y && next_x == gs->player1_x) {
+            gs->player1_hp--;
+            if (gs->player1_hp <= 0)
+                gs->game_over = 1;
+            gs->projectiles[i].active = 0;
+            unlock_position(gs, next_y, next_x);
+            unlock_position(gs, proj_y, proj_x);
             continue;
         }
 
         // Collision with Player 2
-        if (next_y == game_state->player2_y && next_x == game_state->player2_x) {
-            game_state->player2_hp--;
-            if (game_state->player2_hp <= 0)
-                game_state->game_over = 1;
-            game_state->projectiles[i].active = 0;
-            unlock_position(next_y, next_x);
-            unlock_position(proj_y, proj_x);
+        if (next_y == gs->player2_y && next_x == gs->player2_x) {
+            gs->player2_hp--;
+            if (gs->player2_hp <= 0)
+                gs->game_over = 1;
+            gs->projectiles[i].active = 0;
+            unlock_position(gs, next_y, next_x);
+            unlock_position(gs, proj_y, proj_x);
             continue;
         }
 
         // Move the projectile to the new position
-        game_state->projectiles[i].x = next_x;
-        game_state->projectiles[i].y = next_y;
+        gs->projectiles[i].x = next_x;
+        gs->projectiles[i].y = next_y;
+
+        unlock_position(gs, next_y, next_x);
+        unlock_position(gs, proj_y, proj_x);
+    }
+}
 
-        unlock_position(next_y, next_x);
-        unlock_position(proj_y, proj_x);
+// Apply one input of a player to a state
+void apply_input(GameState *gs, char which_player, const InputCmd *cmd) {
+    if (cmd->fire)
+        fire_projectile(gs, which_player);
+    else
+        move_player(gs, which_player, cmd->dx, cmd->dy);
+}
+
+// Apply and empty the input queue of a player
+void apply_queued_inputs(GameState *gs, char which_player) {
+    // Determine pointers to the player's queue
+    InputCmd *queue;
+    int *len, *seq;
+
+    if (which_player == 'A') {
+        queue = gs->player1_queue;
+        len = &gs->player1_queue_len;
+        seq = &gs->player1_input_seq;
+    } else {
+        queue = gs->player2_queue;
+        len = &gs->player2_queue_len;
+        seq = &gs->player2_input_seq;
+    }
+
+    for (int i = 0; i < *len; i++) {
+        apply_input(gs, which_player, &queue[i]);
+        // Acknowledge predicted inputs (keys of the other process have seq 0)
+        if (queue[i].seq > *seq)
+            *seq = queue[i].seq;
+    }
+    *len = 0;
+}
+
+// One simulation tick: queued inputs of both players, then projectiles
+// Deterministic, so the predicted copy can replay it exactly
+void simulate_tick(GameState *gs) {
+    apply_queued_inputs(gs, 'A');
+    apply_queued_inputs(gs, 'B');
+    update_projectiles(gs);
+    gs->tick++;
+}
+
+// Add an input to a player's queue in the shared state
+// Returns 0 if the queue is full and the input was dropped
+int queue_input(char which_player, const InputCmd *cmd) {
+    InputCmd *queue = (which_player == 'A') ? game_state->player1_queue
+                                            : game_state->player2_queue;
+    int *len = (which_player == 'A') ? &game_state->player1_queue_len
+                                     : &game_state->player2_queue_len;
+    int queued = 0;
+
+    lock_projectile_update();  // The tick must not apply the queue meanwhile
+    if (*len < MAX_PENDING_INPUTS) {
+        queue[(*len)++] = *cmd;
+        queued = 1;
+    }
+    unlock_projectile_update();
+
+    return queued;
+}
+
+// Convert a key into an input, returns 1 if the key is one of the bindings
+int key_to_input(const char keys[5], int ch, InputCmd *cmd) {
+    cmd->seq = 0;
+    cmd->tick = 0;
+    cmd->dx = 0;
+    cmd->dy = 0;
+    cmd->fire = 0;
+
+    if (ch == keys[0])
+        cmd->dy = -1;     // up
+    else if (ch == keys[1])
+        cmd->dy = 1;      // down
+    else if (ch == keys[2])
+        cmd->dx = -1;     // left
+    else if (ch == keys[3])
+        cmd->dx = 1;      // right
+    else if (ch == keys[4])
+        cmd->fire = 1;    // fire
+    else
+        return 0;
+
+    return 1;
+}
+
+// Apply our own input to the predicted copy, then queue it for the next tick
+void predict_input(InputCmd *cmd) {
+    cmd->seq = ++next_input_seq;
+    cmd->tick = local_tick;
+
+    apply_input(&predicted_state, player_id, cmd);  // Shown in this frame
+
+    // A dropped input disappears from the prediction at the next resync
+    if (!queue_input(player_id, cmd))
+        return;
+
+    // If the buffer is full the input only shows up once a tick has applied it
+    if (pending_count < MAX_PENDING_INPUTS)
+        pending_inputs[pending_count++] = *cmd;
+}
+
+// Nanoseconds between two times
+long elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+// Roll the predicted copy back to the shared state and re-simulate it up
+// to our local tick, with our inputs that the shared state has not applied yet
+void resync_prediction() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Snapshot of the shared state (a plain copy, it has no pointers)
+    memcpy(&predicted_state, game_state, sizeof(GameState));
+
+    // Our queued inputs are replayed from pending_inputs at their own tick
+    if (player_id == 'A')
+        predicted_state.player1_queue_len = 0;
+    else
+        predicted_state.player2_queue_len = 0;
+
+    // Drop the inputs already applied to the shared state
+    int acked = (player_id == 'A') ? predicted_state.player1_input_seq
+                                   : predicted_state.player2_input_seq;
+    int kept = 0;
+    for (int i = 0; i < pending_count; i++) {
+        if (pending_inputs[i].seq > acked)
+            pending_inputs[kept++] = pending_inputs[i];
+    }
+    pending_count = kept;
+
+    // The shared state may be ahead when the other process ran the ticks
+    if (local_tick < predicted_state.tick)
+        local_tick = predicted_state.tick;
+
+    // Nothing to re-simulate, the copy equals the shared state
+    int depth = local_tick - predicted_state.tick;
+    if (pending_count == 0 && depth == 0)
+        return;
+
+    // Re-simulate tick by tick, each input before the tick it was issued in
+    int next = 0;
+    for (;;) {
+        while (next < pending_count && pending_inputs[next].tick <= predicted_state.tick)
+            apply_input(&predicted_state, player_id, &pending_inputs[next++]);
+        if (predicted_state.tick >= local_tick)
+            break;
+        simulate_tick(&predicted_state);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    rollback_count++;
+    if (depth > rollback_depth_max)
+        rollback_depth_max = depth;
+    resim_ns += elapsed_ns(&start, &end);
+}
+
+// Publish the rollback statistics once per second
+void update_prediction_stats() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (elapsed_ns(&stats_start, &now) >= 1000000000L) {
+        shown_rollbacks = rollback_count;
+        shown_depth_max = rollback_depth_max;
+        shown_resim_us = resim_ns / 1000;
+        rollback_count = 0;
+        rollback_depth_max = 0;
+        resim_ns = 0;
+        stats_start = now;
     }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 8) {
+    if (argc != 8 && !(argc == 9 && strcmp(argv[8], "fog") == 0)) {
         fprintf(stderr, "Usage: %s <map_file> <player_id> ", argv[0]);
-        fprintf(stderr, "<up> <down> <left> <right> <fire>\n");
+        fprintf(stderr, "<up> <down> <left> <right> <fire> [fog]\n");
         fprintf(stderr, "Example A: %s map.txt A w s a d f\n", argv[0]);
         fprintf(stderr, "Example B: %s map.txt B i k j l space\n", argv[0]);
         return 1;
@@ -548,6 +911,8 @@ int main(int argc, char *argv[]) {
     my_keys[3] = argv[6][0];  // right
     my_keys[4] = (strcmp(argv[7], "space") == 0) ? ' ' : argv[7][0];  // fire
 
+    fog_requested = (argc == 9);  // Optional "fog" argument
+
     signal(SIGINT, signal_handler);  // Handle Ctrl+C
     signal(SIGTERM, signal_handler); // Handle kill
     atexit(cleanup);                // Call cleanup() on exit
@@ -602,6 +967,13 @@ int main(int argc, char *argv[]) {
             shmdt(game_state);
             return 1;
         }
+
+        // Fog of war is set by the first player, both play with the same mode
+        if (fog_requested != game_state->fog_of_war) {
+            printf("Fog of war is %s, as chosen by the first player\n",
+                   game_state->fog_of_war ? "on" : "off");
+            sleep(2);  // Leave time to read it before ncurses clears the screen
+        }
     }
 
     // Register key bindings in shared memory
@@ -625,39 +997,31 @@ int main(int argc, char *argv[]) {
     keypad(stdscr, TRUE);   // Enable special keys (arrows, etc.)
     curs_set(0);            // Hide the cursor
 
+    clock_gettime(CLOCK_MONOTONIC, &stats_start);
+
     int frame_counter = 0;
     while (!game_state->game_over) {
         // Read a key
         int ch = getch(); // Returns key code or -1
+        InputCmd cmd;
 
         // Check keys for Player A (if registered)
-        if (game_state->player1_registered) {
-            if (ch == game_state->player1_keys[0]) {
-                move_player('A', 0, -1);  // up
-            } else if (ch == game_state->player1_keys[1]) {
-                move_player('A', 0, 1);   // down
-            } else if (ch == game_state->player1_keys[2]) {
-                move_player('A', -1, 0);  // left
-            } else if (ch == game_state->player1_keys[3]) {
-                move_player('A', 1, 0);   // right
-            } else if (ch == game_state->player1_keys[4]) {
-                fire_projectile('A');     // fire
-            }
+        // Our own inputs are predicted, the other player's are only queued
+        if (game_state->player1_registered &&
+            key_to_input(game_state->player1_keys, ch, &cmd)) {
+            if (player_id == 'A')
+                predict_input(&cmd);
+            else
+                queue_input('A', &cmd);
         }
 
         // Check keys for Player B (if registered)
-        if (game_state->player2_registered) {
-            if (ch == game_state->player2_keys[0]) {
-                move_player('B', 0, -1);  // up
-            } else if (ch == game_state->player2_keys[1]) {
-                move_player('B', 0, 1);   // down
-            } else if (ch == game_state->player2_keys[2]) {
-                move_player('B', -1, 0);  // left
-            } else if (ch == game_state->player2_keys[3]) {
-                move_player('B', 1, 0);   // right
-            } else if (ch == game_state->player2_keys[4]) {
-                fire_projectile('B');     // fire
-            }
+        if (game_state->player2_registered &&
+            key_to_input(game_state->player2_keys, ch, &cmd)) {
+            if (player_id == 'B')
+                predict_input(&cmd);
+            else
+                queue_input('B', &cmd);
         }
 
         // Quit game
@@ -665,25 +1029,30 @@ int main(int argc, char *argv[]) {
             game_state->game_over = 1;
         }
 
-        // Update projectiles with global semaphore
+        // Simulation tick (queued inputs and projectiles) with global semaphore
         frame_counter++;
         if (frame_counter % 2 == 0) { // Every 2 frames
-            // Only one process can update projectiles
+            // Only one process can run the tick
             if (try_lock_projectile_update()) {
-                update_projectiles();
+                simulate_tick(game_state);
                 unlock_projectile_update();
             }
             // If this process fails, the other will handle it
+            local_tick++;  // The predicted copy moves on either way
         }
 
+        // Roll the predicted copy back to the latest shared state
+        resync_prediction();
+        update_prediction_stats();
+
         // Draw everything
-        draw_game();
+        draw_game(&predicted_state);
         // Delay (30ms = ~33 FPS)
         usleep(30000);
     }
 
     if (game_state->game_over) {
-        draw_game(); // Display final screen
+        draw_game(game_state); // Display final screen
         sleep(3);   // Wait 3 seconds
         should_cleanup = 1; // Mark for IPC resource cleanup
     }